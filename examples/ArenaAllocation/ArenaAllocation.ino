@@ -0,0 +1,87 @@
+/////////////////////////////////////////////////////////////////
+/*
+    This shows how to build a state machine without heap allocations.
+    A counting arena first measures how many bytes the transitions need.
+    Then the real machine is built on a fixed buffer, if the buffer is big enough.
+    Use the printed number to size the buffer for your own machine.
+*/
+/////////////////////////////////////////////////////////////////
+
+#include "SimpleFSM.h"
+
+/////////////////////////////////////////////////////////////////
+
+SimpleFSM fsm;
+
+alignas(max_align_t) uint8_t fsm_buffer[512];
+FSMArena arena(fsm_buffer, sizeof(fsm_buffer));
+
+/////////////////////////////////////////////////////////////////
+
+void on_red() {
+  Serial.println("\nState: RED");
+}
+ 
+void on_green() {
+  Serial.println("\nState: GREEN");
+}
+
+/////////////////////////////////////////////////////////////////
+
+State s[] = {
+  State("red", on_red),
+  State("green", on_green)
+};
+
+TimedTransition timedTransitions[] = {
+  TimedTransition(&s[0], &s[1], 6000),
+  TimedTransition(&s[1], &s[0], 4000),
+};
+
+int num_timed = sizeof(timedTransitions) / sizeof(TimedTransition);
+
+/////////////////////////////////////////////////////////////////
+
+size_t measure() {
+  FSMArena counter;
+  SimpleFSM dry_run;
+  dry_run.setAllocator(&counter);
+  dry_run.add(timedTransitions, num_timed);
+  return counter.getUsed();
+}
+
+/////////////////////////////////////////////////////////////////
+
+void setup() {
+  Serial.begin(9600);
+  while (!Serial) {
+    delay(300);
+  }
+  Serial.println();
+  Serial.println("SimpleFSM - Arena Allocation\n");
+
+  size_t needed = measure();
+  Serial.print("Bytes needed: ");
+  Serial.println(needed);
+  Serial.print("Buffer size: ");
+  Serial.println(sizeof(fsm_buffer));
+  if (needed > sizeof(fsm_buffer)) {
+    Serial.println("Buffer is too small");
+    return;
+  }
+
+  fsm.setAllocator(&arena);
+  fsm.add(timedTransitions, num_timed);
+  Serial.print("Bytes used: ");
+  Serial.println(arena.getUsed());
+
+  fsm.setInitialState(&s[0]);
+}
+
+/////////////////////////////////////////////////////////////////
+
+void loop() {
+  fsm.run();
+}
+
+/////////////////////////////////////////////////////////////////
@@ -97,20 +97,60 @@ void button_handler(Button2 btn) {
 
 /////////////////////////////////////////////////////////////////
 
-void showGraph() {
+void showPage() {
   String message = "";
   message += F("<html>\n");
   message += F("<head>\n");
-  message += F("<meta http-equiv='refresh' content='1'>\n");
   message += F("<title>GraphVizArt</title>\n");
+  message += F("<script src='https://unpkg.com/@viz-js/viz@3/lib/viz-standalone.js'></script>\n");
   message += F("</head>\n");
   message += F("<body>\n");
-  message += F("<a href='http://gravizo.com/'><img src='https://g.gravizo.com/svg?");
-  message += fsm.getDotDefinition();
-  message += F("'/></a>");
+  message += F("<div id='graph'></div>\n");
+  message += F("<script>\n");
+  // load the graph once, then only poll the small state deltas
+  message += F("let version = '', active = null, active_fill = 'none';\n");
+  message += F("async function loadGraph() {\n");
+  message += F("  const res = await fetch('/graph');\n");
+  message += F("  version = (res.headers.get('ETag') || '').replace(/^W\\/|\"/g, '');\n");
+  message += F("  const viz = await Viz.instance();\n");
+  message += F("  document.getElementById('graph').replaceChildren(viz.renderSVGElement(await res.text()));\n");
+  message += F("  active = null;\n");
+  message += F("}\n");
+  message += F("async function poll() {\n");
+  message += F("  const [v, seq, state, transition] = (await (await fetch('/state')).text()).trim().split(' ');\n");
+  message += F("  if (v != version) await loadGraph();\n");
+  // restore the fill of the last node, Graphviz sets it explicitly
+  message += F("  if (active) active.setAttribute('fill', active_fill);\n");
+  message += F("  active = document.querySelector('#s' + state + ' ellipse');\n");
+  message += F("  if (active) {\n");
+  message += F("    active_fill = active.getAttribute('fill') || 'none';\n");
+  message += F("    active.setAttribute('fill', 'lightgrey');\n");
+  message += F("  }\n");
+  message += F("}\n");
+  message += F("loadGraph().then(() => setInterval(poll, 500));\n");
+  message += F("</script>\n");
   message += F("</body>\n");
   message += F("</html>\n");
-  server.send ( 200, F("text/html"), message);
+  server.send(200, F("text/html"), message);
+}
+
+/////////////////////////////////////////////////////////////////
+
+void sendGraph() {
+  // an ETag is a quoted string
+  String etag = "\"" + String(fsm.getTopologyVersion(), HEX) + "\"";
+  server.sendHeader(F("ETag"), etag);
+  if (server.header("If-None-Match") == etag) {
+    server.send(304);
+    return;
+  }
+  server.send(200, F("text/vnd.graphviz"), fsm.getDotTopology());
+}
+
+/////////////////////////////////////////////////////////////////
+
+void sendState() {
+  server.send(200, F("text/plain"), fsm.getStateDelta());
 }
 
 /////////////////////////////////////////////////////////////////
@@ -139,7 +179,11 @@ void setup() {
     Serial.print(WiFi.localIP());
     Serial.print(F(" in your browser.\n"));
 
-    server.on( "/", showGraph);
+    const char* headers[] = {"If-None-Match"};
+    server.collectHeaders(headers, 1);
+    server.on("/", showPage);
+    server.on("/graph", sendGraph);
+    server.on("/state", sendState);
     server.onNotFound([](){
       server.send(404, F("text/plain"), F("File Not Found\n"));
     });
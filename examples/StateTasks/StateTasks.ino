@@ -0,0 +1,113 @@
+/////////////////////////////////////////////////////////////////
+/*
+    This shows how to use a coroutine as the activity of a state.
+    While "blinking", the LED toggles every 250ms until the button is pressed.
+    After 3 toggles it waits for the button before it goes on blinking.
+    Leaving the state cancels the task.
+    Needs a C++20 compiler (e.g. ESP32 Arduino core 3.x).
+*/
+/////////////////////////////////////////////////////////////////
+
+#include "SimpleFSM.h"
+#include "Button2.h"    // https://github.com/LennartHennigs/Button2
+
+#ifndef SIMPLEFSM_COROUTINES
+  #error "this example needs C++20 coroutines"
+#endif
+
+/////////////////////////////////////////////////////////////////
+
+#define BUTTON_PIN  39
+#define LED_PIN     LED_BUILTIN
+
+/////////////////////////////////////////////////////////////////
+
+SimpleFSM fsm;
+Button2 btn;
+
+/////////////////////////////////////////////////////////////////
+
+enum triggers {
+  button_was_pressed = 1,
+  stop_blinking
+};
+
+/////////////////////////////////////////////////////////////////
+
+void on_blinking() {
+  Serial.println("\nState: BLINKING");
+}
+
+void on_off() {
+  Serial.println("\nState: OFF");
+  digitalWrite(LED_PIN, LOW);
+}
+
+/////////////////////////////////////////////////////////////////
+
+StateTask blink() {
+  bool on = false;
+  while (true) {
+    for (int i = 0; i < 3; i++) {
+      on = !on;
+      digitalWrite(LED_PIN, on ? HIGH : LOW);
+      co_await StateTask::sleep(250);
+    }
+    Serial.println("waiting for the button...");
+    co_await StateTask::waitFor(button_was_pressed);
+  }
+}
+
+/////////////////////////////////////////////////////////////////
+
+State s[] = {
+  State("blinking", on_blinking),
+  State("off", on_off)
+};
+
+Transition transitions[] = {
+  Transition(&s[0], &s[1], stop_blinking),
+  Transition(&s[1], &s[0], button_was_pressed)
+};
+
+int num_transitions = sizeof(transitions) / sizeof(Transition);
+
+/////////////////////////////////////////////////////////////////
+
+void button_handler(Button2 &btn) {
+  fsm.trigger(button_was_pressed);
+}
+
+void long_press_handler(Button2 &btn) {
+  fsm.trigger(stop_blinking);
+}
+
+/////////////////////////////////////////////////////////////////
+
+void setup() {
+  Serial.begin(9600);
+  while (!Serial) {
+    delay(300);
+  }
+  Serial.println();
+  Serial.println("SimpleFSM - State Tasks (coroutine blinking)\n");
+
+  pinMode(LED_PIN, OUTPUT);
+  s[0].setTask(blink);
+
+  fsm.add(transitions, num_transitions);
+  fsm.setInitialState(&s[0]);
+
+  btn.begin(BUTTON_PIN);
+  btn.setTapHandler(button_handler);
+  btn.setLongClickHandler(long_press_handler);
+}
+
+/////////////////////////////////////////////////////////////////
+
+void loop() {
+  fsm.run();
+  btn.loop();
+}
+
+/////////////////////////////////////////////////////////////////
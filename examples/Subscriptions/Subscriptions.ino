@@ -0,0 +1,92 @@
+/////////////////////////////////////////////////////////////////
+/*
+    This shows how to subscribe to state changes.
+    The light switches every 500ms.
+    One subscriber is called on every transition,
+    a second one is batched and only gets the changes every 3 seconds.
+*/
+/////////////////////////////////////////////////////////////////
+
+#include "SimpleFSM.h"
+
+/////////////////////////////////////////////////////////////////
+
+SimpleFSM fsm;
+unsigned long last_flush = 0;
+
+/////////////////////////////////////////////////////////////////
+
+State s[] = {
+  State("on",  NULL),
+  State("off", NULL)
+};
+
+enum triggers {
+  light_switch_flipped = 1  
+};
+
+Transition transitions[] = {
+  Transition(&s[0], &s[1], light_switch_flipped, NULL, "switch off"),
+  Transition(&s[1], &s[0], light_switch_flipped, NULL, "switch on")
+};
+
+int num_transitions = sizeof(transitions) / sizeof(Transition);
+
+/////////////////////////////////////////////////////////////////
+
+void print_record(const FSMTransitionRecord& r) {
+  Serial.print(r.timestamp);
+  Serial.print(": ");
+  Serial.print(r.from ? r.from->getName() : "-");
+  Serial.print(" -> ");
+  Serial.print(r.to->getName());
+  if (r.coalesced > 0) {
+    Serial.print(" (+");
+    Serial.print(r.coalesced);
+    Serial.print(" merged)");
+  }
+  Serial.println();
+}
+
+void on_change(const FSMTransitionRecord& r) {
+  Serial.print("now   ");
+  print_record(r);
+}
+
+void on_batch(const FSMTransitionRecord& r) {
+  Serial.print("batch ");
+  print_record(r);
+}
+
+/////////////////////////////////////////////////////////////////
+
+void setup() {
+  Serial.begin(9600);
+  while (!Serial) {
+    delay(300);
+  }
+  Serial.println();
+  Serial.println();
+  Serial.println("SimpleFSM - Subscriptions\n");
+    
+  fsm.add(transitions, num_transitions);
+  fsm.setInitialState(&s[1]);
+  fsm.subscribe(on_change);
+  fsm.subscribe(on_batch, true);
+}
+
+/////////////////////////////////////////////////////////////////
+
+void loop() {
+  fsm.run();
+  if (fsm.lastTransitioned() > 500) {
+    fsm.trigger(light_switch_flipped);
+  }
+  // deliver the batched records outside of the transitions
+  if (millis() - last_flush > 3000) {
+    last_flush = millis();
+    fsm.flushNotifications();
+  }
+}
+
+/////////////////////////////////////////////////////////////////
@@ -0,0 +1,124 @@
+/////////////////////////////////////////////////////////////////
+/*
+    This is a stress test to find the worst case durations of
+    run() and trigger() on your board.
+    It builds machines that hit the slow paths of the library and
+    prints the count, p50, p99 and max of each phase.
+    On ESP boards the values are CPU cycles, otherwise microseconds.
+    It also prints the memory each machine uses.
+    Run it for each release to track the worst cases and size regressions.
+*/
+/////////////////////////////////////////////////////////////////
+
+#include "SimpleFSM.h"
+
+/////////////////////////////////////////////////////////////////
+
+#define NUM_STATES  32
+#define NUM_EVENTS  8
+#define NUM_TIMED   64
+#define ROUNDS      2000
+
+/////////////////////////////////////////////////////////////////
+
+State states[NUM_STATES];
+Transition transitions[NUM_STATES * NUM_EVENTS];
+TimedTransition timedTransitions[NUM_TIMED];
+
+/////////////////////////////////////////////////////////////////
+
+bool never() {
+  return false;
+}
+
+bool always() {
+  return true;
+}
+
+void callback() {
+}
+
+/////////////////////////////////////////////////////////////////
+
+void setupStates() {
+  for (int i = 0; i < NUM_STATES; i++) {
+    states[i].setup("s" + String(i), callback, callback, callback);
+  }
+}
+
+/////////////////////////////////////////////////////////////////
+// every state has a transition for every event, all with guards and callbacks
+
+void wideMachine(FSMProfiler& profiler) {
+  SimpleFSM fsm;
+  for (int i = 0; i < NUM_STATES; i++) {
+    for (int e = 0; e < NUM_EVENTS; e++) {
+      transitions[i * NUM_EVENTS + e].setup(&states[i], &states[(i + e + 1) % NUM_STATES], e + 1, callback, "", always);
+    }
+  }
+  fsm.add(transitions, NUM_STATES * NUM_EVENTS);
+  fsm.setInitialState(&states[0]);
+  fsm.setProfiler(&profiler);
+  fsm.getMemoryUsage().print(Serial);
+  for (int r = 0; r < ROUNDS; r++) {
+    // hits and misses (event 0 has no transition)
+    fsm.trigger(r % (NUM_EVENTS + 1));
+  }
+}
+
+/////////////////////////////////////////////////////////////////
+// all timed transitions leave the same state, but their guards fail, so each run() scans all of them
+
+void timedMachine(FSMProfiler& profiler) {
+  SimpleFSM fsm;
+  for (int i = 0; i < NUM_TIMED; i++) {
+    timedTransitions[i].setup(&states[0], &states[1 + i % (NUM_STATES - 1)], 1, callback, "", never);
+  }
+  fsm.add(timedTransitions, NUM_TIMED);
+  fsm.setInitialState(&states[0]);
+  fsm.setProfiler(&profiler);
+  fsm.getMemoryUsage().print(Serial);
+  for (int r = 0; r < ROUNDS; r++) {
+    fsm.run(0);
+    delayMicroseconds(100);
+  }
+}
+
+/////////////////////////////////////////////////////////////////
+
+void report(const char* name, FSMProfiler& profiler) {
+  Serial.println();
+  Serial.println(name);
+  profiler.print(Serial);
+}
+
+/////////////////////////////////////////////////////////////////
+
+void setup() {
+  Serial.begin(9600);
+  while (!Serial) {
+    delay(300);
+  }
+  Serial.println();
+  Serial.println("SimpleFSM - Worst Case Profiling\n");
+
+  setupStates();
+
+  FSMProfiler profiler;
+  Serial.println("wide machine");
+  wideMachine(profiler);
+  report("wide machine", profiler);
+
+  profiler.reset();
+  Serial.println();
+  Serial.println("timed machine");
+  timedMachine(profiler);
+  report("timed machine", profiler);
+}
+
+/////////////////////////////////////////////////////////////////
+
+void loop() {
+}
+
+/////////////////////////////////////////////////////////////////
@@ -0,0 +1,104 @@
+/////////////////////////////////////////////////////////////////
+#include "FSMAllocator.h"
+
+#include <stdlib.h>
+/////////////////////////////////////////////////////////////////
+
+void* FSMHeapAllocator::allocate(size_t size) {
+  return malloc(size);
+}
+
+/////////////////////////////////////////////////////////////////
+
+void FSMHeapAllocator::deallocate(void* p, size_t /* size */) {
+  free(p);
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Get the shared heap allocator.
+ */
+
+FSMHeapAllocator* FSMHeapAllocator::instance() {
+  static FSMHeapAllocator heap;
+  return &heap;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Constructor. Creates an arena without a buffer, in counting mode.
+ * It takes the memory from the heap and adds up the bytes the
+ * same calls would use in a buffer.
+ */
+
+FSMArena::FSMArena() {
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Constructor.
+ *
+ * @param buffer The memory to allocate from, should be aligned.
+ * @param size The size of the buffer in bytes.
+ */
+
+FSMArena::FSMArena(void* buffer, size_t size) {
+  this->buffer = (uint8_t*)buffer;
+  this->capacity = size;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Round a size up to the alignment of the arena.
+ */
+
+size_t FSMArena::align(size_t size) {
+  const size_t a = alignof(max_align_t);
+  return (size + a - 1) & ~(a - 1);
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Take the next block from the buffer.
+ */
+
+void* FSMArena::allocate(size_t size) {
+  size = align(size);
+  if (buffer == NULL) {
+    used += size;
+    return malloc(size);
+  }
+  if (size > capacity - used) return NULL;
+  void* p = buffer + used;
+  used += size;
+  return p;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Memory is not given back to an arena.
+ */
+
+void FSMArena::deallocate(void* p, size_t /* size */) {
+  if (buffer == NULL) free(p);
+}
+
+/////////////////////////////////////////////////////////////////
+
+size_t FSMArena::getUsed() const {
+  return used;
+}
+
+/////////////////////////////////////////////////////////////////
+
+size_t FSMArena::getCapacity() const {
+  return capacity;
+}
+
+/////////////////////////////////////////////////////////////////
+
+bool FSMArena::isCounting() const {
+  return buffer == NULL;
+}
+
+/////////////////////////////////////////////////////////////////
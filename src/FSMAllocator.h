@@ -0,0 +1,59 @@
+/////////////////////////////////////////////////////////////////
+
+#pragma once
+#ifndef FSM_ALLOCATOR_H
+#define FSM_ALLOCATOR_H
+
+/////////////////////////////////////////////////////////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+/////////////////////////////////////////////////////////////////
+// interface for all memory the state machine allocates
+
+class FSMAllocator {
+ public:
+  virtual ~FSMAllocator(){};
+  virtual void* allocate(size_t size) = 0;
+  virtual void deallocate(void* p, size_t size) = 0;
+};
+
+/////////////////////////////////////////////////////////////////
+// default allocator, uses the general heap
+
+class FSMHeapAllocator : public FSMAllocator {
+ public:
+  void* allocate(size_t size);
+  void deallocate(void* p, size_t size);
+
+  static FSMHeapAllocator* instance();
+};
+
+/////////////////////////////////////////////////////////////////
+// bump allocator on a user supplied buffer
+// without a buffer it counts the bytes a machine would need
+
+class FSMArena : public FSMAllocator {
+ public:
+  FSMArena();
+  FSMArena(void* buffer, size_t size);
+
+  void* allocate(size_t size);
+  void deallocate(void* p, size_t size);
+
+  size_t getUsed() const;
+  size_t getCapacity() const;
+  bool isCounting() const;
+
+  static size_t align(size_t size);
+
+ protected:
+  uint8_t* buffer = NULL;
+  size_t capacity = 0;
+  size_t used = 0;
+};
+
+/////////////////////////////////////////////////////////////////
+#endif
+/////////////////////////////////////////////////////////////////
@@ -0,0 +1,100 @@
+/////////////////////////////////////////////////////////////////
+#include "FSMProfiler.h"
+/////////////////////////////////////////////////////////////////
+
+void FSMProfiler::record(FSMPhase phase, uint32_t ticks) {
+  count[phase]++;
+  if (ticks > max[phase]) max[phase] = ticks;
+  // bucket n holds values below 2^n
+  int bucket = 0;
+  while (bucket < BUCKETS - 1 && (ticks >> bucket) != 0) bucket++;
+  histogram[phase][bucket]++;
+}
+
+/////////////////////////////////////////////////////////////////
+
+void FSMProfiler::reset() {
+  for (int p = 0; p < FSM_PHASE_COUNT; p++) {
+    count[p] = 0;
+    max[p] = 0;
+    for (int b = 0; b < BUCKETS; b++) histogram[p][b] = 0;
+  }
+}
+
+/////////////////////////////////////////////////////////////////
+
+unsigned long FSMProfiler::getCount(FSMPhase phase) const {
+  return count[phase];
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Get the longest measured duration of a phase.
+ */
+
+uint32_t FSMProfiler::getMax(FSMPhase phase) const {
+  return max[phase];
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Get an upper bound for a percentile of a phase.
+ * The value is rounded up to the next power of two, but never above the maximum.
+ */
+
+uint32_t FSMProfiler::getPercentile(FSMPhase phase, int percent) const {
+  if (count[phase] == 0) return 0;
+  if (percent < 0) percent = 0;
+  if (percent > 100) percent = 100;
+  // split the count so count * percent cannot overflow a 32-bit unsigned long
+  unsigned long needed = (count[phase] / 100) * percent + ((count[phase] % 100) * percent + 99) / 100;
+  unsigned long seen = 0;
+  for (int b = 0; b < BUCKETS; b++) {
+    seen += histogram[phase][b];
+    if (seen >= needed) {
+      uint32_t bound = (b == 0) ? 0 : (b >= 32) ? 0xFFFFFFFFUL : ((1UL << b) - 1);
+      return (bound < max[phase]) ? bound : max[phase];
+    }
+  }
+  return max[phase];
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Print a table with count, p50, p99 and max of each phase.
+ */
+
+void FSMProfiler::print(Print& out) const {
+  out.println("phase\tcount\tp50\tp99\tmax");
+  for (int p = 0; p < FSM_PHASE_COUNT; p++) {
+    FSMPhase phase = (FSMPhase)p;
+    out.print(getPhaseName(phase));
+    out.print("\t");
+    out.print(getCount(phase));
+    out.print("\t");
+    out.print((unsigned long)getPercentile(phase, 50));
+    out.print("\t");
+    out.print((unsigned long)getPercentile(phase, 99));
+    out.print("\t");
+    out.println((unsigned long)getMax(phase));
+  }
+}
+
+/////////////////////////////////////////////////////////////////
+
+const char* FSMProfiler::getPhaseName(FSMPhase phase) {
+  switch (phase) {
+    case FSM_PHASE_LOOKUP: return "lookup";
+    case FSM_PHASE_GUARD: return "guard";
+    case FSM_PHASE_ON_EXIT: return "on_exit";
+    case FSM_PHASE_ON_RUN: return "on_run";
+    case FSM_PHASE_ON_ENTER: return "on_enter";
+    case FSM_PHASE_TIMED_SCAN: return "timed";
+    case FSM_PHASE_TASK: return "task";
+    case FSM_PHASE_TRIGGER: return "trigger";
+    case FSM_PHASE_RUN: return "run";
+    default: return "?";
+  }
+}
+
+/////////////////////////////////////////////////////////////////
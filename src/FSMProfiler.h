@@ -0,0 +1,64 @@
+/////////////////////////////////////////////////////////////////
+
+#pragma once
+#ifndef FSM_PROFILER_H
+#define FSM_PROFILER_H
+
+/////////////////////////////////////////////////////////////////
+
+#include "Arduino.h"
+
+/////////////////////////////////////////////////////////////////
+// clock used for the measurements, cycles where available
+// to use your own, set it as a global build flag (-D), it is used in SimpleFSM.cpp
+
+#ifndef SIMPLEFSM_PROFILE_CLOCK
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP8266)
+#define SIMPLEFSM_PROFILE_CLOCK() ((uint32_t)ESP.getCycleCount())
+#else
+#define SIMPLEFSM_PROFILE_CLOCK() ((uint32_t)micros())
+#endif
+#endif
+
+/////////////////////////////////////////////////////////////////
+
+enum FSMPhase {
+  FSM_PHASE_LOOKUP = 0,
+  FSM_PHASE_GUARD,
+  FSM_PHASE_ON_EXIT,
+  FSM_PHASE_ON_RUN,
+  FSM_PHASE_ON_ENTER,
+  FSM_PHASE_TIMED_SCAN,
+  FSM_PHASE_TASK,
+  FSM_PHASE_TRIGGER,
+  FSM_PHASE_RUN,
+  FSM_PHASE_COUNT
+};
+
+/////////////////////////////////////////////////////////////////
+// keeps the maximum and a log2 histogram per phase
+
+class FSMProfiler {
+ public:
+  static const int BUCKETS = 33;
+
+  void record(FSMPhase phase, uint32_t ticks);
+  void reset();
+
+  unsigned long getCount(FSMPhase phase) const;
+  uint32_t getMax(FSMPhase phase) const;
+  uint32_t getPercentile(FSMPhase phase, int percent) const;
+
+  void print(Print& out) const;
+
+  static const char* getPhaseName(FSMPhase phase);
+
+ protected:
+  unsigned long count[FSM_PHASE_COUNT] = {};
+  uint32_t max[FSM_PHASE_COUNT] = {};
+  unsigned long histogram[FSM_PHASE_COUNT][BUCKETS] = {};
+};
+
+/////////////////////////////////////////////////////////////////
+#endif
+/////////////////////////////////////////////////////////////////
@@ -3,6 +3,27 @@
 
 #include "State.h"
 #include "Transitions.h"
+
+#if defined(__has_include)
+#if __has_include(<new>)
+#include <new>
+#else
+#include <new.h>
+#endif
+#else
+#include <new.h>
+#endif
+
+// orders the seqlock accesses, on AVR there is only one core
+#if defined(__AVR__)
+#define SIMPLEFSM_BARRIER() __asm__ __volatile__("" ::: "memory")
+#else
+#define SIMPLEFSM_BARRIER() __sync_synchronize()
+#endif
+
+// measure the duration of a phase, only if a profiler is set
+#define SIMPLEFSM_PROFILE_START(t) uint32_t t = (profiler != NULL) ? SIMPLEFSM_PROFILE_CLOCK() : 0
+#define SIMPLEFSM_PROFILE_END(t, phase) if (profiler != NULL) profiler->record(phase, SIMPLEFSM_PROFILE_CLOCK() - t)
 /////////////////////////////////////////////////////////////////
 
 SimpleFSM::SimpleFSM() {
@@ -24,8 +45,11 @@ SimpleFSM::SimpleFSM(State* initial_state) {
  */
 
 SimpleFSM::~SimpleFSM() {
-  transitions = NULL;
-  timed = NULL;
+#ifdef SIMPLEFSM_COROUTINES
+  _stopTask();
+#endif
+  _freeTransitions();
+  _freeSubscriptions();
 }
 
 /////////////////////////////////////////////////////////////////
@@ -52,13 +76,20 @@ int SimpleFSM::getTimedTransitionCount() const {
  */
 
 void SimpleFSM::reset() {
+#ifdef SIMPLEFSM_COROUTINES
+  _stopTask();
+#endif
   is_initialized = false;
-  is_finished = false;
   last_run = 0;
-  last_transition = 0;
   setInitialState(inital_state);
+  _beginWrite();
+  is_finished = false;
+  last_transition = 0;
   current_state = NULL;
   prev_state = NULL;
+  _endWrite();
+  last_transition_id = -1;
+  transition_count = 0;
 
   for (int i = 0; i < num_timed; i++) {
     timed[i].reset();
@@ -72,6 +103,7 @@ void SimpleFSM::reset() {
 
 void SimpleFSM::setInitialState(State* state) {
   inital_state = state;
+  topology_version = 0;
 }
 
 /////////////////////////////////////////////////////////////////
@@ -81,13 +113,96 @@ void SimpleFSM::setInitialState(State* state) {
 
 bool SimpleFSM::trigger(int event_id) {
   if (!is_initialized) _initFSM();
+  return _trigger(event_id);
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Trigger a list of events, e.g. to replay recorded events.
+ * A convenience loop, each event costs the same as a trigger() call.
+ *
+ * @param events The event IDs.
+ * @param n The number of events.
+ * @param results If not NULL, gets the result of each trigger.
+ * @return The number of transitions that took place.
+ */
+
+int SimpleFSM::triggerBatch(const int* events, size_t n, bool* results /* = NULL */) {
+  if (!is_initialized) _initFSM();
+  int count = 0;
+  for (size_t i = 0; i < n; i++) {
+    bool fired = _trigger(events[i]);
+    if (results != NULL) results[i] = fired;
+    if (fired) count++;
+  }
+  return count;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Trigger events on a fleet of machines.
+ * Like the variant above, it calls trigger() on each machine in turn.
+ *
+ * @param machines The state machines.
+ * @param instances For each event, the index of its machine.
+ * @param events The event IDs.
+ * @param n The number of events.
+ * @param results If not NULL, gets the result of each trigger.
+ * @return The number of transitions that took place.
+ */
+
+int SimpleFSM::triggerBatch(SimpleFSM* machines[], const int* instances, const int* events, size_t n, bool* results /* = NULL */) {
+  int count = 0;
+  for (size_t i = 0; i < n; i++) {
+    SimpleFSM* fsm = machines[instances[i]];
+    if (!fsm->is_initialized) fsm->_initFSM();
+    bool fired = fsm->_trigger(events[i]);
+    if (results != NULL) results[i] = fired;
+    if (fired) count++;
+  }
+  return count;
+}
+
+/////////////////////////////////////////////////////////////////
+
+bool SimpleFSM::_trigger(int event_id) {
+  SIMPLEFSM_PROFILE_START(t_trigger);
+#ifdef SIMPLEFSM_COROUTINES
+  // wake up a task that waits for this event
+  _handleTaskEvent(event_id);
+#endif
   // Find the transition with the current state and given event
-  for (int i = 0; i < num_standard; i++) {
-    if (transitions[i].from == current_state && transitions[i].event_id == event_id) {
-      return _transitionTo(&(transitions[i]));
+  SIMPLEFSM_PROFILE_START(t_lookup);
+  int i = _findTransition(event_id);
+  SIMPLEFSM_PROFILE_END(t_lookup, FSM_PHASE_LOOKUP);
+  bool fired = (i >= 0) && _transitionTo(&(transitions[i]));
+  SIMPLEFSM_PROFILE_END(t_trigger, FSM_PHASE_TRIGGER);
+  return fired;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Find the first transition for the current state and an event.
+ * Binary search on the sorted lookup table.
+ */
+
+int SimpleFSM::_findTransition(int event_id) const {
+  uintptr_t state = (uintptr_t)current_state;
+  int low = 0;
+  int high = num_standard;
+  while (low < high) {
+    int mid = (low + high) / 2;
+    uintptr_t from = (uintptr_t)lookup[mid].from;
+    if (from < state || (from == state && lookup[mid].event_id < event_id)) {
+      low = mid + 1;
+    } else {
+      high = mid;
     }
   }
-  return false;
+  if (low < num_standard && lookup[low].from == current_state && lookup[low].event_id == event_id) {
+    return lookup[low].index;
+  }
+  return -1;
 }
 
 /////////////////////////////////////////////////////////////////
@@ -126,44 +241,145 @@ void SimpleFSM::setTransitionHandler(CallbackFunction f) {
   on_transition_cb = f;
 }
 
+/////////////////////////////////////////////////////////////////
+/*
+ * Subscribe to state changes.
+ * The slots are allocated with the first subscription, the queue with
+ * the first batched one.
+ *
+ * @param f The function that receives the transition records.
+ * @param batched If true, records are queued and only delivered by flushNotifications().
+ * @return The subscription ID or -1 if there is no free slot or no memory for it.
+ */
+
+int SimpleFSM::subscribe(TransitionObserver f, bool batched /* = false */) {
+  if (f == NULL) return -1;
+  if (subscribers == NULL) {
+    size_t bytes = SIMPLEFSM_MAX_SUBSCRIBERS * sizeof(FSMSubscriber);
+    if (!_fitsBudget(bytes)) return -1;
+    subscribers = (FSMSubscriber*)allocator->allocate(bytes);
+    if (subscribers == NULL) return -1;
+    for (int i = 0; i < SIMPLEFSM_MAX_SUBSCRIBERS; i++) {
+      subscribers[i].observer = NULL;
+      subscribers[i].batched = false;
+    }
+  }
+  int id = -1;
+  for (int i = 0; i < SIMPLEFSM_MAX_SUBSCRIBERS && id < 0; i++) {
+    if (subscribers[i].observer == NULL) id = i;
+  }
+  if (id < 0) return -1;
+  if (batched && notify_queue == NULL) {
+    size_t bytes = SIMPLEFSM_NOTIFY_QUEUE_SIZE * sizeof(FSMTransitionRecord);
+    if (!_fitsBudget(bytes)) return -1;
+    notify_queue = (FSMTransitionRecord*)allocator->allocate(bytes);
+    if (notify_queue == NULL) return -1;
+    for (int i = 0; i < SIMPLEFSM_NOTIFY_QUEUE_SIZE; i++) {
+      new (&notify_queue[i]) FSMTransitionRecord();
+    }
+  }
+  subscribers[id].observer = f;
+  subscribers[id].batched = batched;
+  return id;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Remove a subscription.
+ */
+
+bool SimpleFSM::unsubscribe(int id) {
+  if (subscribers == NULL || id < 0 || id >= SIMPLEFSM_MAX_SUBSCRIBERS || subscribers[id].observer == NULL) return false;
+  subscribers[id].observer = NULL;
+  subscribers[id].batched = false;
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Deliver the queued records to the batched subscribers.
+ * Call it from your loop, outside of the transition callbacks.
+ *
+ * @return The number of delivered records.
+ */
+
+int SimpleFSM::flushNotifications() {
+  int delivered = 0;
+  while (notify_count > 0) {
+    FSMTransitionRecord record = notify_queue[notify_head];
+    notify_head = (notify_head + 1) % SIMPLEFSM_NOTIFY_QUEUE_SIZE;
+    notify_count--;
+    for (int i = 0; i < SIMPLEFSM_MAX_SUBSCRIBERS; i++) {
+      if (subscribers[i].observer != NULL && subscribers[i].batched) subscribers[i].observer(record);
+    }
+    delivered++;
+  }
+  return delivered;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Set the allocator for the transition storage and the subscriptions.
+ * Must be called before the first add() or subscribe().
+ */
+
+bool SimpleFSM::setAllocator(FSMAllocator* allocator) {
+  if (allocator == NULL || transitions != NULL || timed != NULL || subscribers != NULL) return false;
+  this->allocator = allocator;
+  return true;
+}
+
 /////////////////////////////////////////////////////////////////
 /* 
  * Add transitions to the FSM.
  * 
  * @param t[] An array of transitions.
  * @param size The size of the array.  
+ * @return false if the allocator is out of storage or the memory budget is exceeded.
  */
 
-void SimpleFSM::add(Transition newTransitions[], int size) {
+bool SimpleFSM::add(Transition newTransitions[], int size) {
   // Count the number of unique transitions
   int uniqueCount = 0;
+  size_t nameBytes = 0;
   for (int i = 0; i < size; ++i) {
     if (!_isDuplicate(newTransitions[i], transitions, num_standard) && 
         !_isDuplicate(newTransitions[i], newTransitions, i)) {
       uniqueCount++;
+      nameBytes += _nameBytes(newTransitions[i]);
     }
   }
-  // Allocate or expand storage for transitions with exact size
-  Transition* temp = new Transition[num_standard + uniqueCount];
-  if (transitions != NULL) {
-    memcpy((void*)temp, transitions, num_standard * sizeof(Transition));
-    delete[] transitions;
+  if (uniqueCount == 0) return true;
+  // Check the memory budget
+  if (!_fitsBudget(uniqueCount * (sizeof(Transition) + sizeof(FSMLookupEntry)) + nameBytes)) return false;
+  // Allocate new storage with exact size
+  FSMLookupEntry* table = (FSMLookupEntry*)allocator->allocate((num_standard + uniqueCount) * sizeof(FSMLookupEntry));
+  if (table == NULL) return false;
+  Transition* temp = (Transition*)allocator->allocate((num_standard + uniqueCount) * sizeof(Transition));
+  if (temp == NULL) {
+    allocator->deallocate(table, (num_standard + uniqueCount) * sizeof(FSMLookupEntry));
+    return false;
   }
-  transitions = temp;
-  // Check if memory allocation was successful
-  if (transitions == NULL) {
-    Serial.print("Out of storage");
-    abort();
+  // Move the existing transitions over, their names are not copied
+  for (int i = 0; i < num_standard; ++i) {
+    new (&temp[i]) Transition(static_cast<Transition&&>(transitions[i]));
+    transitions[i].~Transition();
   }
+  if (transitions != NULL) allocator->deallocate(transitions, num_standard * sizeof(Transition));
+  if (lookup != NULL) allocator->deallocate(lookup, num_standard * sizeof(FSMLookupEntry));
+  transitions = temp;
+  lookup = table;
   // Add new transitions, avoiding duplicates
   for (int i = 0; i < size; ++i) {
     if (!_isDuplicate(newTransitions[i], transitions, num_standard) && 
         !_isDuplicate(newTransitions[i], newTransitions, i)) {
-      transitions[num_standard] = newTransitions[i];
-      _addDotTransition(transitions[num_standard]);
+      new (&transitions[num_standard]) Transition(newTransitions[i]);
       num_standard++;
     }
   }
+  _buildLookup();
+  topology_version = 0;
+  return true;
 }
 
 /////////////////////////////////////////////////////////////////
@@ -172,38 +388,222 @@ void SimpleFSM::add(Transition newTransitions[], int size) {
   * 
   * @param t[] An array of timed transitions.
   * @param size The size of the array.  
+  * @return false if the allocator is out of storage or the memory budget is exceeded.
   */
 
-void SimpleFSM::add(TimedTransition newTransitions[], int size) {
+bool SimpleFSM::add(TimedTransition newTransitions[], int size) {
   // Count the number of unique transitions
   int uniqueCount = 0;
+  size_t nameBytes = 0;
   for (int i = 0; i < size; ++i) {
     if (!_isDuplicate(newTransitions[i], timed, num_timed) && 
         !_isDuplicate(newTransitions[i], newTransitions, i)) {
       uniqueCount++;
+      nameBytes += _nameBytes(newTransitions[i]);
     }
   }
-  // Allocate memory or expand existing storage with exact size
-  TimedTransition* temp = new TimedTransition[num_timed + uniqueCount];
-  if (timed != NULL) {
-    memcpy((void*)temp, timed, num_timed * sizeof(TimedTransition));
-    delete[] timed;
+  if (uniqueCount == 0) return true;
+  // Check the memory budget
+  if (!_fitsBudget(uniqueCount * sizeof(TimedTransition) + nameBytes)) return false;
+  // Allocate new storage with exact size
+  TimedTransition* temp = (TimedTransition*)allocator->allocate((num_timed + uniqueCount) * sizeof(TimedTransition));
+  if (temp == NULL) return false;
+  // Move the existing transitions over, their names are not copied
+  for (int i = 0; i < num_timed; ++i) {
+    new (&temp[i]) TimedTransition(static_cast<TimedTransition&&>(timed[i]));
+    timed[i].~TimedTransition();
   }
+  if (timed != NULL) allocator->deallocate(timed, num_timed * sizeof(TimedTransition));
   timed = temp;
-  // Check memory allocation
-  if (timed == NULL) {
-    Serial.print("Out of storage");
-    abort();
-  }
   // Add new transitions while avoiding duplicates
   for (int i = 0; i < size; ++i) {
     if (!_isDuplicate(newTransitions[i], timed, num_timed) && 
         !_isDuplicate(newTransitions[i], newTransitions, i)) {
-      timed[num_timed] = newTransitions[i];
-      _addDotTransition(timed[num_timed]);
+      new (&timed[num_timed]) TimedTransition(newTransitions[i]);
       num_timed++;
     }
   }
+  topology_version = 0;
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Set the maximum number of bytes add() and subscribe() may use for
+ * transitions, the lookup table, their names and the subscriptions.
+ * 0 means no limit.
+ */
+
+void SimpleFSM::setMemoryBudget(size_t bytes) {
+  memory_budget = bytes;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Get the number of bytes the machine uses, by category.
+ * States are counted if they are part of a transition or the initial state.
+ * Names are counted with their length plus terminator. This is an estimate,
+ * cores round up the String capacity or store short strings inline, and
+ * the heap adds its own overhead per block.
+ * The coroutine pool is shared by all machines and not part of the totals.
+ */
+
+FSMMemoryReport SimpleFSM::getMemoryUsage() {
+  FSMMemoryReport report;
+  report.machine = sizeof(SimpleFSM);
+#ifdef SIMPLEFSM_COROUTINES
+  report.task_pool = (size_t)SIMPLEFSM_TASK_POOL_SIZE * SIMPLEFSM_TASK_FRAME_SIZE;
+#endif
+  report.transitions = num_standard * sizeof(Transition);
+  report.timed = num_timed * sizeof(TimedTransition);
+  report.lookup = num_standard * sizeof(FSMLookupEntry);
+  report.subscriptions = _subscriptionBytes();
+  int count = num_standard + num_timed;
+  bool has_initial = (inital_state == NULL);
+  for (int i = 0; i < count; i++) {
+    AbstractTransition* t = (i < num_standard) ? (AbstractTransition*)&transitions[i] : (AbstractTransition*)&timed[i - num_standard];
+    report.names += _nameBytes(*t);
+    State* nodes[] = {t->from, t->to};
+    for (int n = 0; n < 2; n++) {
+      if (n == 1 && nodes[1] == nodes[0]) continue;
+      if (_isNodeListed(nodes[n], i)) continue;
+      if (nodes[n] == inital_state) has_initial = true;
+      report.states += sizeof(State);
+      if (nodes[n]->name.length() > 0) report.names += nodes[n]->name.length() + 1;
+    }
+  }
+  if (!has_initial) {
+    report.states += sizeof(State);
+    if (inital_state->name.length() > 0) report.names += inital_state->name.length() + 1;
+  }
+  return report;
+}
+
+/////////////////////////////////////////////////////////////////
+
+bool SimpleFSM::_fitsBudget(size_t extra) {
+  return memory_budget == 0 || _allocatedBytes() + extra <= memory_budget;
+}
+
+/////////////////////////////////////////////////////////////////
+
+size_t SimpleFSM::_allocatedBytes() {
+  size_t bytes = num_standard * (sizeof(Transition) + sizeof(FSMLookupEntry)) + num_timed * sizeof(TimedTransition);
+  bytes += _subscriptionBytes();
+  for (int i = 0; i < num_standard; i++) bytes += _nameBytes(transitions[i]);
+  for (int i = 0; i < num_timed; i++) bytes += _nameBytes(timed[i]);
+  return bytes;
+}
+
+/////////////////////////////////////////////////////////////////
+
+size_t SimpleFSM::_subscriptionBytes() const {
+  size_t bytes = 0;
+  if (subscribers != NULL) bytes += SIMPLEFSM_MAX_SUBSCRIBERS * sizeof(FSMSubscriber);
+  if (notify_queue != NULL) bytes += SIMPLEFSM_NOTIFY_QUEUE_SIZE * sizeof(FSMTransitionRecord);
+  return bytes;
+}
+
+/////////////////////////////////////////////////////////////////
+
+size_t SimpleFSM::_nameBytes(const AbstractTransition& t) const {
+  return (t.name.length() > 0) ? t.name.length() + 1 : 0;
+}
+
+/////////////////////////////////////////////////////////////////
+
+size_t FSMMemoryReport::getStaticBytes() const {
+  return machine + states;
+}
+
+/////////////////////////////////////////////////////////////////
+
+size_t FSMMemoryReport::getAllocatedBytes() const {
+  return transitions + timed + lookup + subscriptions + names;
+}
+
+/////////////////////////////////////////////////////////////////
+
+size_t FSMMemoryReport::getTotalBytes() const {
+  return getStaticBytes() + getAllocatedBytes();
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Print the report, one category per line.
+ */
+
+void FSMMemoryReport::print(Print& out) const {
+  const char* labels[] = {"machine", "states", "transitions", "timed", "lookup", "subscriptions", "names"};
+  const size_t values[] = {machine, states, transitions, timed, lookup, subscriptions, names};
+  for (int i = 0; i < 7; i++) {
+    out.print(labels[i]);
+    out.print("\t");
+    out.println((unsigned long)values[i]);
+  }
+  out.print("static\t");
+  out.println((unsigned long)getStaticBytes());
+  out.print("allocated\t");
+  out.println((unsigned long)getAllocatedBytes());
+  out.print("total\t");
+  out.println((unsigned long)getTotalBytes());
+  out.print("shared task_pool\t");
+  out.println((unsigned long)task_pool);
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Destroy the transitions and give their storage back.
+ */
+
+void SimpleFSM::_freeTransitions() {
+  for (int i = 0; i < num_standard; i++) {
+    transitions[i].~Transition();
+  }
+  for (int i = 0; i < num_timed; i++) {
+    timed[i].~TimedTransition();
+  }
+  if (transitions != NULL) allocator->deallocate(transitions, num_standard * sizeof(Transition));
+  if (timed != NULL) allocator->deallocate(timed, num_timed * sizeof(TimedTransition));
+  if (lookup != NULL) allocator->deallocate(lookup, num_standard * sizeof(FSMLookupEntry));
+  transitions = NULL;
+  timed = NULL;
+  lookup = NULL;
+  num_standard = 0;
+  num_timed = 0;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Give the subscription slots and the queue back.
+ */
+
+void SimpleFSM::_freeSubscriptions() {
+  if (subscribers != NULL) allocator->deallocate(subscribers, SIMPLEFSM_MAX_SUBSCRIBERS * sizeof(FSMSubscriber));
+  if (notify_queue != NULL) allocator->deallocate(notify_queue, SIMPLEFSM_NOTIFY_QUEUE_SIZE * sizeof(FSMTransitionRecord));
+  subscribers = NULL;
+  notify_queue = NULL;
+  notify_head = 0;
+  notify_count = 0;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Fill the lookup table.
+ * Entries are sorted by state and event, equal ones keep the order they were added in.
+ */
+
+void SimpleFSM::_buildLookup() {
+  for (int i = 0; i < num_standard; i++) {
+    FSMLookupEntry entry = {transitions[i].from, transitions[i].event_id, i};
+    int j = i;
+    while (j > 0 && ((uintptr_t)lookup[j - 1].from > (uintptr_t)entry.from ||
+                     (lookup[j - 1].from == entry.from && lookup[j - 1].event_id > entry.event_id))) {
+      lookup[j] = lookup[j - 1];
+      j--;
+    }
+    lookup[j] = entry;
+  }
 }
 
 /////////////////////////////////////////////////////////////////
@@ -273,11 +673,23 @@ bool SimpleFSM::isFinished() const {
 */
 
 void SimpleFSM::run(int interval /* = 1000 */, CallbackFunction tick_cb /* = NULL */) {
+  SIMPLEFSM_PROFILE_START(t_run);
+  _run(interval, tick_cb);
+  SIMPLEFSM_PROFILE_END(t_run, FSM_PHASE_RUN);
+}
+
+/////////////////////////////////////////////////////////////////
+
+void SimpleFSM::_run(int interval, CallbackFunction tick_cb) {
   unsigned long now = millis();
   // is the machine set up?
   if (!is_initialized) _initFSM();
   // are we ok?
   if (current_state == NULL) return;
+#ifdef SIMPLEFSM_COROUTINES
+  // resume the state task independent of the interval
+  if (!is_finished) _handleTask(now);
+#endif
   // is it time?
   if (!_isTimeForRun(now, interval)) return;
   // are we done yet?
@@ -285,7 +697,9 @@ void SimpleFSM::run(int interval /* = 1000 */, CallbackFunction tick_cb /* = NUL
   // save the time
   last_run = now;
   // go through the timed events
+  SIMPLEFSM_PROFILE_START(t_timed);
   _handleTimedEvents(now);
+  SIMPLEFSM_PROFILE_END(t_timed, FSM_PHASE_TIMED_SCAN);
   // trigger the on_state event
   if (current_state->on_state != NULL) current_state->on_state();
   // trigger the regular tick event
@@ -333,30 +747,109 @@ bool SimpleFSM::_initFSM() {
 /////////////////////////////////////////////////////////////////
 /*
  * Change to a new state.
+ *
+ * @param s The new state.
+ * @param now The time of the change.
+ * @param transition The transition that leads to it, NULL for the initial state.
  */
 
-bool SimpleFSM::_changeToState(State* s, unsigned long now) {
+bool SimpleFSM::_changeToState(State* s, unsigned long now, AbstractTransition* transition /* = NULL */) {
   if (s == NULL) return false;
-  // set the new state
+  // set the new state and save the time
+  _beginWrite();
   prev_state = current_state;
   current_state = s;
-  if (s->on_enter != NULL) s->on_enter();
-  // save the time
-  last_run = now;
   last_transition = now;
+  if (s->is_final) is_finished = true;
+  _endWrite();
+  last_run = now;
+  // report it before on_enter, so nested transitions are reported in order
+  _notify(transition ? transition->from : NULL, s, transition, now);
+#ifdef SIMPLEFSM_COROUTINES
+  // before on_enter, a transition fired from there cancels it
+  if (!s->is_final) _startTask(s);
+#endif
+  if (s->on_enter != NULL) {
+    SIMPLEFSM_PROFILE_START(t_enter);
+    s->on_enter();
+    SIMPLEFSM_PROFILE_END(t_enter, FSM_PHASE_ON_ENTER);
+  }
   // is this the end?
   if (s->is_final && finished_cb != NULL) finished_cb();
-  if (s->is_final) is_finished = true;
   return true;
 }
 
+/////////////////////////////////////////////////////////////////
+/*
+ * Set a profiler to measure run() and trigger() and their phases.
+ * Pass NULL to stop profiling.
+ */
+
+void SimpleFSM::setProfiler(FSMProfiler* profiler) {
+  this->profiler = profiler;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Start a seqlock write, the sequence number is odd while writing.
+ */
+
+void SimpleFSM::_beginWrite() {
+  seq = seq + 1;
+  SIMPLEFSM_BARRIER();
+}
+
+/////////////////////////////////////////////////////////////////
+
+void SimpleFSM::_endWrite() {
+  SIMPLEFSM_BARRIER();
+  seq = seq + 1;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Get a consistent copy of the state, previous state, transition time
+ * and finished flag. Can be called from other threads while the owner
+ * runs the machine. It never blocks the owner, instead it retries if a
+ * transition happened while reading.
+ *
+ * @param snapshot The snapshot to fill.
+ * @param tries How often to retry, -1 to retry until it succeeds.
+ * @return false if no consistent copy was read.
+ */
+
+bool SimpleFSM::getSnapshot(FSMSnapshot& snapshot, int tries /* = 8 */) const {
+  while (tries != 0) {
+    unsigned int begin = seq;
+    SIMPLEFSM_BARRIER();
+    snapshot.state = current_state;
+    snapshot.previous = prev_state;
+    snapshot.transitioned_at = last_transition;
+    snapshot.finished = is_finished;
+    SIMPLEFSM_BARRIER();
+    if ((begin & 1) == 0 && begin == seq) {
+      snapshot.version = begin >> 1;
+      return true;
+    }
+    if (tries > 0) tries--;
+  }
+  return false;
+}
+
 /////////////////////////////////////////////////////////////////
 /*
  * Get the DOT definition of the FSM.
  */
 
 String SimpleFSM::getDotDefinition() {
-  return "digraph G {\n" + _dot_header() + dot_definition + _dot_active_node() + _dot_inital_state() + "}\n";
+  String dot = "digraph G {\n" + _dot_header();
+  for (int i = 0; i < num_standard; i++) {
+    dot += _dot_transition(transitions[i]);
+  }
+  for (int i = 0; i < num_timed; i++) {
+    dot += _dot_transition(timed[i]);
+  }
+  return dot + _dot_active_node() + _dot_inital_state() + "}\n";
 }
 
 /////////////////////////////////////////////////////////////////
@@ -365,18 +858,171 @@ bool SimpleFSM::_transitionTo(AbstractTransition* transition) {
   // empty parameter?
   if (transition->to == NULL) return false;
   // can I pass the guard
-  if (transition->guard_cb != NULL && !transition->guard_cb()) return false;
+  if (transition->guard_cb != NULL) {
+    SIMPLEFSM_PROFILE_START(t_guard);
+    bool passed = transition->guard_cb();
+    SIMPLEFSM_PROFILE_END(t_guard, FSM_PHASE_GUARD);
+    if (!passed) return false;
+  }
+#ifdef SIMPLEFSM_COROUTINES
+  // cancel the task of the state we leave
+  _stopTask();
+#endif
   // trigger events
-  if (transition->from->on_exit != NULL) transition->from->on_exit();
-  if (transition->on_run_cb != NULL) transition->on_run_cb();
+  if (transition->from->on_exit != NULL) {
+    SIMPLEFSM_PROFILE_START(t_exit);
+    transition->from->on_exit();
+    SIMPLEFSM_PROFILE_END(t_exit, FSM_PHASE_ON_EXIT);
+  }
+  if (transition->on_run_cb != NULL) {
+    SIMPLEFSM_PROFILE_START(t_on_run);
+    transition->on_run_cb();
+    SIMPLEFSM_PROFILE_END(t_on_run, FSM_PHASE_ON_RUN);
+  }
   if (on_transition_cb != NULL) on_transition_cb();
-  return _changeToState(transition->to, millis());
+  unsigned long now = millis();
+  last_transition_id = transition->getID();
+  transition_count++;
+  return _changeToState(transition->to, now, transition);
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Inform the subscribers about a state change.
+ * Immediate subscribers are called right away, for batched ones the
+ * record is queued. If the queue is full, the change is merged into
+ * the newest record.
+ */
+
+void SimpleFSM::_notify(State* from, State* to, AbstractTransition* transition, unsigned long now) {
+  FSMTransitionRecord record;
+  record.from = from;
+  record.to = to;
+  record.transition = transition;
+  record.timestamp = now;
+  if (subscribers == NULL) return;
+  bool has_batched = false;
+  for (int i = 0; i < SIMPLEFSM_MAX_SUBSCRIBERS; i++) {
+    if (subscribers[i].observer == NULL) continue;
+    if (subscribers[i].batched) {
+      has_batched = true;
+    } else {
+      subscribers[i].observer(record);
+    }
+  }
+  if (!has_batched) return;
+  // queue is full, coalesce with the newest record
+  if (notify_count == SIMPLEFSM_NOTIFY_QUEUE_SIZE) {
+    FSMTransitionRecord& last = notify_queue[(notify_head + notify_count - 1) % SIMPLEFSM_NOTIFY_QUEUE_SIZE];
+    last.to = record.to;
+    last.transition = record.transition;
+    last.timestamp = record.timestamp;
+    last.coalesced++;
+    return;
+  }
+  notify_queue[(notify_head + notify_count) % SIMPLEFSM_NOTIFY_QUEUE_SIZE] = record;
+  notify_count++;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Get the DOT definition without the active state.
+ * Nodes and edges carry the IDs used by getStateDelta(), "s<ID>" for
+ * states and "t<ID>" for transitions. Send it once and then only
+ * the deltas.
+ */
+
+String SimpleFSM::getDotTopology() {
+  String dot = "digraph G {\n" + _dot_header() + _dot_node_ids();
+  for (int i = 0; i < num_standard; i++) {
+    Transition& t = transitions[i];
+    dot += _dot_transition(t.from->getName(), t.to->getName(), t.getName(), "ID=" + String(t.event_id), "id=\"t" + String(t.id) + "\" ");
+  }
+  for (int i = 0; i < num_timed; i++) {
+    TimedTransition& t = timed[i];
+    dot += _dot_transition(t.from->getName(), t.to->getName(), t.getName(), String(t.getInterval()) + "ms", "id=\"t" + String(t.id) + "\" ");
+  }
+  return dot + _dot_inital_state() + "}\n";
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Get a version of the topology, e.g. to use as an ETag.
+ * It changes when transitions are added or the initial state is set.
+ */
+
+unsigned long SimpleFSM::getTopologyVersion() {
+  if (topology_version != 0) return topology_version;
+  // FNV-1a over the IDs of all transitions and their states
+  uint32_t hash = 2166136261UL;
+  const long values[] = {num_standard, num_timed, inital_state ? inital_state->id : -1};
+  for (int i = 0; i < 3; i++) hash = (hash ^ (uint32_t)values[i]) * 16777619UL;
+  for (int i = 0; i < num_standard; i++) {
+    hash = (hash ^ (uint32_t)transitions[i].id) * 16777619UL;
+    hash = (hash ^ (uint32_t)transitions[i].from->id) * 16777619UL;
+    hash = (hash ^ (uint32_t)transitions[i].to->id) * 16777619UL;
+    hash = (hash ^ (uint32_t)transitions[i].event_id) * 16777619UL;
+  }
+  for (int i = 0; i < num_timed; i++) {
+    hash = (hash ^ (uint32_t)timed[i].id) * 16777619UL;
+    hash = (hash ^ (uint32_t)timed[i].from->id) * 16777619UL;
+    hash = (hash ^ (uint32_t)timed[i].to->id) * 16777619UL;
+    hash = (hash ^ (uint32_t)timed[i].interval) * 16777619UL;
+  }
+  topology_version = (hash == 0) ? 1 : hash;
+  return topology_version;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Get the state change since the topology was sent, as one line:
+ * "<topology version> <transition count> <state ID> <transition ID>"
+ * The count is the number of transitions since the start or the last reset().
+ * IDs are -1 if there is no state or no transition fired yet.
+ */
+
+String SimpleFSM::getStateDelta() {
+  String delta = String(getTopologyVersion(), HEX);
+  delta += " " + String(transition_count);
+  delta += " " + String(current_state ? current_state->id : -1);
+  delta += " " + String(last_transition_id);
+  return delta + "\n";
+}
+
+/////////////////////////////////////////////////////////////////
+
+String SimpleFSM::_dot_transition(String from, String to, String label, String param, String attributes /* = "" */) {
+  return "\t\"" + from + "\" -> \"" + to + "\"" + " [" + attributes + "label=\"" + label + " (" + param + ")\"];\n";
+}
+
+/////////////////////////////////////////////////////////////////
+
+String SimpleFSM::_dot_node_ids() {
+  String dot = "";
+  int count = num_standard + num_timed;
+  for (int i = 0; i < count; i++) {
+    AbstractTransition* t = (i < num_standard) ? (AbstractTransition*)&transitions[i] : (AbstractTransition*)&timed[i - num_standard];
+    State* nodes[] = {t->from, t->to};
+    for (int n = 0; n < 2; n++) {
+      if (n == 1 && nodes[1] == nodes[0]) continue;
+      if (_isNodeListed(nodes[n], i)) continue;
+      dot += "\t\"" + nodes[n]->getName() + "\" [id=\"s" + String(nodes[n]->id) + "\"];\n";
+    }
+  }
+  return dot;
 }
 
 /////////////////////////////////////////////////////////////////
+/*
+ * Check if a state is part of one of the first transitions.
+ */
 
-String SimpleFSM::_dot_transition(String from, String to, String label, String param) {
-  return "\t\"" + from + "\" -> \"" + to + "\"" + " [label=\"" + label + " (" + param + ")\"];\n";
+bool SimpleFSM::_isNodeListed(State* s, int before) {
+  for (int i = 0; i < before; i++) {
+    AbstractTransition* t = (i < num_standard) ? (AbstractTransition*)&transitions[i] : (AbstractTransition*)&timed[i - num_standard];
+    if (t->from == s || t->to == s) return true;
+  }
+  return false;
 }
 
 /////////////////////////////////////////////////////////////////
@@ -399,14 +1045,91 @@ String SimpleFSM::_dot_header() {
 
 /////////////////////////////////////////////////////////////////
 
-void SimpleFSM::_addDotTransition(Transition& t) {
-  dot_definition = dot_definition + _dot_transition(t.from->getName(), t.to->getName(), t.getName(), "ID=" + String(t.event_id));
+String SimpleFSM::_dot_transition(const Transition& t) {
+  return _dot_transition(t.from->getName(), t.to->getName(), t.getName(), "ID=" + String(t.event_id));
+}
+
+/////////////////////////////////////////////////////////////////
+
+String SimpleFSM::_dot_transition(const TimedTransition& t) {
+  return _dot_transition(t.from->getName(), t.to->getName(), t.getName(), String(t.getInterval()) + "ms");
+}
+
+/////////////////////////////////////////////////////////////////
+#ifdef SIMPLEFSM_COROUTINES
+/////////////////////////////////////////////////////////////////
+/*
+ * Create the task of a state. It first runs on the next run() call.
+ */
+
+void SimpleFSM::_startTask(State* s) {
+  _stopTask();
+  if (s->task_fn == NULL) return;
+  StateTask t = s->task_fn();
+  task = t.release();
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Cancel the current task.
+ * The task that is running right now is destroyed once it suspends,
+ * any other task is destroyed right away.
+ */
+
+void SimpleFSM::_stopTask() {
+  if (!task) return;
+  if (task == running_task) {
+    running_cancelled = true;
+  } else {
+    task.destroy();
+  }
+  task = StateTask::Handle();
 }
 
 /////////////////////////////////////////////////////////////////
 
-void SimpleFSM::_addDotTransition(TimedTransition& t) {
-  dot_definition = dot_definition + _dot_transition(t.from->getName(), t.to->getName(), t.getName(), String(t.getInterval()) + "ms");
+void SimpleFSM::_resumeTask() {
+  if (!task || running_task || task.done()) return;
+  StateTask::Handle h = task;
+  h.promise().wait = StateTask::WAIT_NONE;
+  running_task = h;
+  running_cancelled = false;
+  SIMPLEFSM_PROFILE_START(t_task);
+  h.resume();
+  SIMPLEFSM_PROFILE_END(t_task, FSM_PHASE_TASK);
+  running_task = StateTask::Handle();
+  // was it cancelled while running?
+  if (running_cancelled) {
+    running_cancelled = false;
+    h.destroy();
+  } else if (h.done()) {
+    h.destroy();
+    task = StateTask::Handle();
+  }
 }
 
 /////////////////////////////////////////////////////////////////
+
+void SimpleFSM::_handleTask(unsigned long now) {
+  if (!task) return;
+  StateTask::promise_type& p = task.promise();
+  if (p.wait == StateTask::WAIT_NONE) {
+    _resumeTask();
+  } else if (p.wait == StateTask::WAIT_TIMER && (long)(now - p.wake_at) >= 0) {
+    _resumeTask();
+  }
+}
+
+/////////////////////////////////////////////////////////////////
+
+void SimpleFSM::_handleTaskEvent(int event_id) {
+  if (!task) return;
+  StateTask::promise_type& p = task.promise();
+  if (p.wait == StateTask::WAIT_EVENT && p.event_id == event_id) {
+    _resumeTask();
+  }
+}
+
+/////////////////////////////////////////////////////////////////
+#endif
+/////////////////////////////////////////////////////////////////
@@ -10,7 +10,10 @@
 #include <functional>
 #endif
 #include "Arduino.h"
+#include "FSMAllocator.h"
+#include "FSMProfiler.h"
 #include "State.h"
+#include "StateTask.h"
 #include "Transitions.h"
 
 /////////////////////////////////////////////////////////////////
@@ -18,6 +21,89 @@
 typedef void (*CallbackFunction)();
 typedef bool (*GuardCondition)();
 
+/////////////////////////////////////////////////////////////////
+// limits of the transition subscriptions
+// they are read in SimpleFSM.cpp, so they must be global build flags (-D),
+// never a #define in a sketch
+
+#ifndef SIMPLEFSM_MAX_SUBSCRIBERS
+#define SIMPLEFSM_MAX_SUBSCRIBERS 4
+#endif
+
+#ifndef SIMPLEFSM_NOTIFY_QUEUE_SIZE
+#define SIMPLEFSM_NOTIFY_QUEUE_SIZE 8
+#endif
+
+/////////////////////////////////////////////////////////////////
+// a state change as seen by the subscribers
+
+struct FSMTransitionRecord {
+  State* from = NULL;
+  State* to = NULL;
+  AbstractTransition* transition = NULL;
+  unsigned long timestamp = 0;
+  int coalesced = 0;
+};
+
+typedef void (*TransitionObserver)(const FSMTransitionRecord& record);
+
+// a subscription slot
+struct FSMSubscriber {
+  TransitionObserver observer;
+  bool batched;
+};
+
+/////////////////////////////////////////////////////////////////
+// flat lookup table entry, sorted by state and event
+
+struct FSMLookupEntry {
+  State* from;
+  int event_id;
+  int index;
+};
+
+/////////////////////////////////////////////////////////////////
+// default memory budget for the transition storage, 0 means no limit
+
+#ifndef SIMPLEFSM_MEMORY_BUDGET
+#define SIMPLEFSM_MEMORY_BUDGET 0
+#endif
+
+/////////////////////////////////////////////////////////////////
+// bytes used by a machine, by category
+
+struct FSMMemoryReport {
+  // static memory, states used by several machines are counted by each of them
+  size_t machine = 0;
+  size_t states = 0;
+  // allocated by add()
+  size_t transitions = 0;
+  size_t timed = 0;
+  size_t lookup = 0;
+  // subscription slots and notification queue, only allocated when used
+  size_t subscriptions = 0;
+  // characters of the name Strings, an estimate of their heap use
+  size_t names = 0;
+  // shared by all machines, not part of the totals
+  size_t task_pool = 0;
+
+  size_t getStaticBytes() const;
+  size_t getAllocatedBytes() const;
+  size_t getTotalBytes() const;
+  void print(Print& out) const;
+};
+
+/////////////////////////////////////////////////////////////////
+// consistent view of the machine, for reading from other threads
+
+struct FSMSnapshot {
+  State* state = NULL;
+  State* previous = NULL;
+  unsigned long transitioned_at = 0;
+  bool finished = false;
+  unsigned int version = 0;
+};
+
 /////////////////////////////////////////////////////////////////
 
 class SimpleFSM {
@@ -25,15 +111,26 @@ class SimpleFSM {
   SimpleFSM();
   SimpleFSM(State* initial_state);
   ~SimpleFSM();
+  // owns its transition storage
+  SimpleFSM(const SimpleFSM&) = delete;
+  SimpleFSM& operator=(const SimpleFSM&) = delete;
 
-  void add(Transition t[], int size);
-  void add(TimedTransition t[], int size);
+  bool add(Transition t[], int size);
+  bool add(TimedTransition t[], int size);
+  bool setAllocator(FSMAllocator* allocator);
+  void setMemoryBudget(size_t bytes);
+  FSMMemoryReport getMemoryUsage();
 
   void setInitialState(State* state);
   void setFinishedHandler(CallbackFunction f);
   void setTransitionHandler(CallbackFunction f);
+  int subscribe(TransitionObserver f, bool batched = false);
+  bool unsubscribe(int id);
+  int flushNotifications();
 
   bool trigger(int event_id);
+  int triggerBatch(const int* events, size_t n, bool* results = NULL);
+  static int triggerBatch(SimpleFSM* machines[], const int* instances, const int* events, size_t n, bool* results = NULL);
   void run(int interval = 1000, CallbackFunction tick_cb = NULL);
   void reset();
 
@@ -45,40 +142,84 @@ class SimpleFSM {
   bool isInState(State* state) const;
   State* getPreviousState() const;
   unsigned long lastTransitioned() const;
+  bool getSnapshot(FSMSnapshot& snapshot, int tries = 8) const;
   String getDotDefinition();
+  String getDotTopology();
+  unsigned long getTopologyVersion();
+  String getStateDelta();
+  void setProfiler(FSMProfiler* profiler);
 
  protected:
   int num_timed = 0;
   int num_standard = 0;
   Transition* transitions = NULL;
   TimedTransition* timed = NULL;
+  FSMLookupEntry* lookup = NULL;
+  size_t memory_budget = SIMPLEFSM_MEMORY_BUDGET;
+  FSMAllocator* allocator = FSMHeapAllocator::instance();
 
   bool is_initialized = false;
   bool is_finished = false;
   unsigned long last_run = 0;
   unsigned long last_transition = 0;
+  volatile unsigned int seq = 0;
 
   State* inital_state = NULL;
   State* current_state = NULL;
   State* prev_state = NULL;
+  int last_transition_id = -1;
+  unsigned long transition_count = 0;
+  unsigned long topology_version = 0;
   CallbackFunction on_transition_cb = NULL;
   CallbackFunction finished_cb = NULL;
 
-  String dot_definition = "";
+  FSMSubscriber* subscribers = NULL;
+  FSMTransitionRecord* notify_queue = NULL;
+  int notify_head = 0;
+  int notify_count = 0;
+  FSMProfiler* profiler = NULL;
+
+#ifdef SIMPLEFSM_COROUTINES
+  StateTask::Handle task;
+  StateTask::Handle running_task;
+  bool running_cancelled = false;
+
+  void _startTask(State* s);
+  void _stopTask();
+  void _resumeTask();
+  void _handleTask(unsigned long now);
+  void _handleTaskEvent(int event_id);
+#endif
 
   bool _isDuplicate(const TimedTransition& transition, const TimedTransition* transitionArray, int arraySize) const;
   bool _isDuplicate(const Transition& transition, const Transition* transitionArray, int arraySize) const;
 
+  void _run(int interval, CallbackFunction tick_cb);
   bool _isTimeForRun(unsigned long now, int interval);
   void _handleTimedEvents(unsigned long now);
   
   bool _initFSM();
   bool _transitionTo(AbstractTransition* transition);
-  bool _changeToState(State* s, unsigned long now);
-
-  void _addDotTransition(Transition& t);
-  void _addDotTransition(TimedTransition& t);
-  String _dot_transition(String from, String to, String label, String param);
+  bool _changeToState(State* s, unsigned long now, AbstractTransition* transition = NULL);
+  void _notify(State* from, State* to, AbstractTransition* transition, unsigned long now);
+  void _beginWrite();
+  void _endWrite();
+
+  void _freeTransitions();
+  void _freeSubscriptions();
+  size_t _subscriptionBytes() const;
+  bool _fitsBudget(size_t extra);
+  size_t _allocatedBytes();
+  size_t _nameBytes(const AbstractTransition& t) const;
+  void _buildLookup();
+  bool _trigger(int event_id);
+  int _findTransition(int event_id) const;
+
+  String _dot_transition(const Transition& t);
+  String _dot_transition(const TimedTransition& t);
+  String _dot_transition(String from, String to, String label, String param, String attributes = "");
+  String _dot_node_ids();
+  bool _isNodeListed(State* s, int before);
   String _dot_inital_state();
   String _dot_header();
   String _dot_active_node();
@@ -75,3 +75,16 @@ void State::setAsFinal(bool final /* = true */) {
 }
 
 /////////////////////////////////////////////////////////////////
+#ifdef SIMPLEFSM_COROUTINES
+/////////////////////////////////////////////////////////////////
+/*
+ * Set the coroutine that runs while the machine is in this state.
+ */
+
+void State::setTask(StateTaskFunction f) {
+  task_fn = f;
+}
+
+/////////////////////////////////////////////////////////////////
+#endif
+/////////////////////////////////////////////////////////////////
@@ -7,6 +7,7 @@
 /////////////////////////////////////////////////////////////////
 
 #include "Arduino.h"
+#include "StateTask.h"
 
 /////////////////////////////////////////////////////////////////
 
@@ -28,6 +29,9 @@ class State {
   void setOnStateHandler(CallbackFunction f);
   void setOnExitHandler(CallbackFunction f);
   void setAsFinal(bool final = true);
+#ifdef SIMPLEFSM_COROUTINES
+  void setTask(StateTaskFunction f);
+#endif
 
   int getID() const;
   bool isFinal() const;
@@ -42,6 +46,9 @@ class State {
   CallbackFunction on_state = NULL;
   CallbackFunction on_exit = NULL;
   bool is_final = false;
+#ifdef SIMPLEFSM_COROUTINES
+  StateTaskFunction task_fn = NULL;
+#endif
 };
 
 /////////////////////////////////////////////////////////////////
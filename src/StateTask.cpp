@@ -0,0 +1,154 @@
+/////////////////////////////////////////////////////////////////
+#include "StateTask.h"
+/////////////////////////////////////////////////////////////////
+#ifdef SIMPLEFSM_COROUTINES
+/////////////////////////////////////////////////////////////////
+
+alignas(max_align_t) static unsigned char task_frames[SIMPLEFSM_TASK_POOL_SIZE][SIMPLEFSM_TASK_FRAME_SIZE];
+static bool task_frame_used[SIMPLEFSM_TASK_POOL_SIZE];
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Take a coroutine frame from the pool.
+ * Returns NULL if the frame is too big or the pool is empty.
+ */
+
+void* StateTask::promise_type::operator new(size_t size) noexcept {
+  if (size > SIMPLEFSM_TASK_FRAME_SIZE) return NULL;
+  for (int i = 0; i < SIMPLEFSM_TASK_POOL_SIZE; i++) {
+    if (!task_frame_used[i]) {
+      task_frame_used[i] = true;
+      return task_frames[i];
+    }
+  }
+  return NULL;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Return a coroutine frame to the pool.
+ */
+
+void StateTask::promise_type::operator delete(void* frame) noexcept {
+  for (int i = 0; i < SIMPLEFSM_TASK_POOL_SIZE; i++) {
+    if (frame == task_frames[i]) {
+      task_frame_used[i] = false;
+      return;
+    }
+  }
+}
+
+/////////////////////////////////////////////////////////////////
+
+StateTask StateTask::promise_type::get_return_object() noexcept {
+  return StateTask(Handle::from_promise(*this));
+}
+
+/////////////////////////////////////////////////////////////////
+
+StateTask StateTask::promise_type::get_return_object_on_allocation_failure() noexcept {
+  return StateTask();
+}
+
+/////////////////////////////////////////////////////////////////
+
+void StateTask::Sleep::await_suspend(Handle h) const noexcept {
+  h.promise().wait = WAIT_TIMER;
+  h.promise().wake_at = millis() + ms;
+}
+
+/////////////////////////////////////////////////////////////////
+
+void StateTask::Event::await_suspend(Handle h) const noexcept {
+  h.promise().wait = WAIT_EVENT;
+  h.promise().event_id = event_id;
+}
+
+/////////////////////////////////////////////////////////////////
+
+StateTask::StateTask() {
+}
+
+/////////////////////////////////////////////////////////////////
+
+StateTask::StateTask(Handle h) : handle(h) {
+}
+
+/////////////////////////////////////////////////////////////////
+
+StateTask::StateTask(StateTask&& other) noexcept : handle(other.release()) {
+}
+
+/////////////////////////////////////////////////////////////////
+
+StateTask& StateTask::operator=(StateTask&& other) noexcept {
+  if (this != &other) {
+    if (handle) handle.destroy();
+    handle = other.release();
+  }
+  return *this;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Destructor. Destroys the coroutine frame if it is still owned.
+ */
+
+StateTask::~StateTask() {
+  if (handle) handle.destroy();
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Check if the coroutine frame could be allocated.
+ */
+
+bool StateTask::isValid() const {
+  return (bool)handle;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Hand over the coroutine frame to the caller.
+ */
+
+StateTask::Handle StateTask::release() {
+  Handle h = handle;
+  handle = Handle();
+  return h;
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Suspend the task for the given number of milliseconds.
+ */
+
+StateTask::Sleep StateTask::sleep(unsigned long ms) {
+  return Sleep{ms};
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Suspend the task until the given event is triggered.
+ */
+
+StateTask::Event StateTask::waitFor(int event_id) {
+  return Event{event_id};
+}
+
+/////////////////////////////////////////////////////////////////
+/*
+ * Get the number of unused coroutine frames in the pool.
+ */
+
+int StateTask::getFreeSlots() {
+  int free_slots = 0;
+  for (int i = 0; i < SIMPLEFSM_TASK_POOL_SIZE; i++) {
+    if (!task_frame_used[i]) free_slots++;
+  }
+  return free_slots;
+}
+
+/////////////////////////////////////////////////////////////////
+#endif
+/////////////////////////////////////////////////////////////////
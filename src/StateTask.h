@@ -0,0 +1,112 @@
+/////////////////////////////////////////////////////////////////
+
+#pragma once
+#ifndef STATE_TASK_H
+#define STATE_TASK_H
+
+/////////////////////////////////////////////////////////////////
+// coroutine tasks need a C++20 compiler
+// SIMPLEFSM_NO_COROUTINES turns them off, it changes the layout of State and
+// SimpleFSM and must be a global build flag (-D), never a #define in a sketch
+
+#if !defined(SIMPLEFSM_NO_COROUTINES) && defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define SIMPLEFSM_COROUTINES
+#endif
+#endif
+
+#ifdef SIMPLEFSM_COROUTINES
+
+/////////////////////////////////////////////////////////////////
+
+#include <coroutine>
+#include <stddef.h>
+
+#include "Arduino.h"
+
+/////////////////////////////////////////////////////////////////
+// coroutine frames are taken from a fixed pool, not from the heap
+// set the sizes as global build flags (-D), the pool lives in StateTask.cpp
+
+#ifndef SIMPLEFSM_TASK_POOL_SIZE
+#define SIMPLEFSM_TASK_POOL_SIZE 4
+#endif
+
+#ifndef SIMPLEFSM_TASK_FRAME_SIZE
+#define SIMPLEFSM_TASK_FRAME_SIZE 128
+#endif
+
+/////////////////////////////////////////////////////////////////
+
+class StateTask {
+  friend class SimpleFSM;
+
+ public:
+  enum WaitType {
+    WAIT_NONE = 0,
+    WAIT_TIMER,
+    WAIT_EVENT
+  };
+
+  struct promise_type {
+    WaitType wait = WAIT_NONE;
+    unsigned long wake_at = 0;
+    int event_id = 0;
+
+    StateTask get_return_object() noexcept;
+    static StateTask get_return_object_on_allocation_failure() noexcept;
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept {}
+
+    static void* operator new(size_t size) noexcept;
+    static void operator delete(void* frame) noexcept;
+  };
+
+  typedef std::coroutine_handle<promise_type> Handle;
+
+  // awaitable returned by sleep()
+  struct Sleep {
+    unsigned long ms;
+    bool await_ready() const noexcept { return ms == 0; }
+    void await_suspend(Handle h) const noexcept;
+    void await_resume() const noexcept {}
+  };
+
+  // awaitable returned by waitFor()
+  struct Event {
+    int event_id;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(Handle h) const noexcept;
+    void await_resume() const noexcept {}
+  };
+
+  StateTask();
+  StateTask(StateTask&& other) noexcept;
+  StateTask& operator=(StateTask&& other) noexcept;
+  StateTask(const StateTask&) = delete;
+  StateTask& operator=(const StateTask&) = delete;
+  ~StateTask();
+
+  bool isValid() const;
+
+  static Sleep sleep(unsigned long ms);
+  static Event waitFor(int event_id);
+  static int getFreeSlots();
+
+ protected:
+  explicit StateTask(Handle h);
+  Handle release();
+
+  Handle handle;
+};
+
+/////////////////////////////////////////////////////////////////
+
+typedef StateTask (*StateTaskFunction)();
+
+/////////////////////////////////////////////////////////////////
+#endif
+#endif
+/////////////////////////////////////////////////////////////////
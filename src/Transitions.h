@@ -24,6 +24,11 @@ class AbstractTransition {
   AbstractTransition();
   // to make this class an interface
   virtual ~AbstractTransition(){};
+  // moves let SimpleFSM grow its storage without copying the names
+  AbstractTransition(const AbstractTransition& other) = default;
+  AbstractTransition(AbstractTransition&& other) = default;
+  AbstractTransition& operator=(const AbstractTransition& other) = default;
+  AbstractTransition& operator=(AbstractTransition&& other) = default;
   virtual int getID() const = 0;
   String getName() const;
 
@@ -49,6 +54,10 @@ class Transition : public AbstractTransition {
  public:
   Transition();
   Transition(State* from, State* to, int event_id, CallbackFunction on_run = NULL, String name = "", GuardCondition guard = NULL);
+  Transition(const Transition& other) = default;
+  Transition(Transition&& other) = default;
+  Transition& operator=(const Transition& other) = default;
+  Transition& operator=(Transition&& other) = default;
 
   void setup(State* from, State* to, int event_id, CallbackFunction on_run = NULL, String name = "", GuardCondition guard = NULL);
 
@@ -67,6 +76,10 @@ class TimedTransition : public AbstractTransition {
  public:
   TimedTransition();
   TimedTransition(State* from, State* to, int interval, CallbackFunction on_run = NULL, String name = "", GuardCondition guard = NULL);
+  TimedTransition(const TimedTransition& other) = default;
+  TimedTransition(TimedTransition&& other) = default;
+  TimedTransition& operator=(const TimedTransition& other) = default;
+  TimedTransition& operator=(TimedTransition&& other) = default;
 
   void setup(State* from, State* to, int interval, CallbackFunction on_run = NULL, String name = "", GuardCondition guard = NULL);
 